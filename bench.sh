@@ -0,0 +1,60 @@
+#!/bin/sh
+# Time linemap, whichvars and dyntest on synthetic programs of growing size
+# built with the same flag sets the tools themselves are built with. Each
+# size is funcs:locals, the programs are generated with benchgen and every
+# run's --stats report is kept in dir along with a line of totals per run
+# in dir/results.
+#
+# Usage: bench.sh [-d dir][-j N] [funcs:locals...]
+
+dir=bench.out
+jobs=1
+while getopts d:j: opt; do
+    case $opt in
+	d) dir=$OPTARG ;;
+	j) jobs=$OPTARG ;;
+	*) echo "Usage: $0 [-d dir][-j N] [funcs:locals...]" >&2; exit 1 ;;
+    esac
+done
+shift $((OPTIND-1))
+sizes=${*:-"100:10 1000:10 1000:50 10000:10"}
+
+CXXFLAGS="-g3 -std=c++17"
+GCCXXFLAGS="-fvar-tracking-assignments -gstatement-frontiers -gvariable-location-views"
+mkdir -p "$dir" || exit 1
+results=$dir/results
+: > "$results"
+
+# flags name, compiler and its flags
+build(){
+    name=$1; cxx=$2; shift 2
+    $cxx $CXXFLAGS "$@" -o "$src/prog.$name" "$src"/*.C
+}
+
+for size in $sizes; do
+    funcs=${size%:*}
+    locals=${size#*:}
+    src=$dir/f${funcs}_l${locals}
+    ./benchgen -f "$funcs" -l "$locals" -u $(( (funcs+99)/100 )) "$src" ||
+	exit 1
+    for flags in O0 O1 O2 O3 Og lto clang; do
+	case $flags in
+	    lto) build $flags c++ $GCCXXFLAGS -O2 -flto ;;
+	    clang) build $flags clang++ -O2 ;;
+	    *) build $flags c++ $GCCXXFLAGS -$flags ;;
+	esac || continue
+	prog=$src/prog.$flags
+	for tool in "./linemap -q" "./whichvars" "./dyntest -p -g"; do
+	    name=${tool%% *}
+	    name=${name#./}
+	    out=$src/$name.$flags.stats
+	    case $name in
+		dyntest) $tool --stats -j "$jobs" "$prog" >/dev/null 2>"$out" ;;
+		*) $tool --stats -N -j "$jobs" "$prog" >/dev/null 2>"$out" ;;
+	    esac
+	    echo "$name $flags funcs=$funcs locals=$locals" \
+		 $(grep '^Total' "$out") >> "$results"
+	done
+    done
+done
+cat "$results"
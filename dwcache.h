@@ -0,0 +1,348 @@
+#ifndef DWQUAL_DWCACHE_H
+#define DWQUAL_DWCACHE_H
+
+#include <string>
+#include <vector>
+#include <fstream>
+#include <functional>
+#include <cstdint>
+#include <cstring>
+#include <cstdlib>
+
+#include <elf.h>
+#include <fcntl.h>
+#include <unistd.h>
+#include <limits.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+
+#include "dwinfo.h"
+
+/* A program_info is saved after the DWARF has been read so that later runs
+   on the same binary can mmap it instead of parsing the DWARF again. The
+   file is a cache_header followed by the program_info tables in order, each
+   padded to 8 bytes. The header records which binary it was made from, by
+   build-id when there is one and always by mtime and size. */
+
+static const char CACHE_MAGIC[8]={'D','W','Q','U','A','L','C','\0'};
+static const uint32_t CACHE_VERSION=1;
+static const char CACHE_SUFFIX[]=".dwqual";
+
+struct binary_key{
+  uint32_t build_id_length=0;
+  unsigned char build_id[64]={};
+  uint32_t pad=0;
+  int64_t mtime_sec=0;
+  int64_t mtime_nsec=0;
+  uint64_t size=0;
+  bool operator==(const binary_key &o) const {
+    return build_id_length==o.build_id_length &&
+      memcmp(build_id,o.build_id,build_id_length)==0 &&
+      mtime_sec==o.mtime_sec && mtime_nsec==o.mtime_nsec && size==o.size;
+  }
+};
+
+struct cache_header{
+  char magic[8];
+  uint32_t version;
+  uint32_t pad;
+  binary_key key;
+  // the number of records in each table in the order they follow
+  uint64_t nstrings,nmodules,nstmts,nfuncs,nvars,nranges;
+};
+
+struct cache_options{
+  std::string dir; // where to keep caches, empty for next to the binary
+  bool use=true;
+  bool rebuild=false; // ignore any existing cache and write a new one
+};
+
+template<typename Ehdr, typename Phdr>
+static bool find_build_id( const unsigned char *base, size_t size,
+			   binary_key &key){
+  if(size<sizeof(Ehdr))
+    return false;
+  auto eh=reinterpret_cast<const Ehdr*>(base);
+  for(unsigned p=0;p<eh->e_phnum;p++){
+    size_t at=eh->e_phoff+p*eh->e_phentsize;
+    if(at+sizeof(Phdr)>size)
+      return false;
+    auto ph=reinterpret_cast<const Phdr*>(base+at);
+    if(ph->p_type!=PT_NOTE || ph->p_offset+ph->p_filesz>size)
+      continue;
+    // notes are a 12 byte header then the name and desc each padded to 4
+    size_t n=ph->p_offset, end=ph->p_offset+ph->p_filesz;
+    while(n+sizeof(Elf64_Nhdr)<=end){
+      auto nh=reinterpret_cast<const Elf64_Nhdr*>(base+n);
+      size_t name=n+sizeof(Elf64_Nhdr);
+      size_t desc=name+((nh->n_namesz+3)&~3u);
+      size_t next=desc+((nh->n_descsz+3)&~3u);
+      if(next>end)
+	break;
+      if(nh->n_type==NT_GNU_BUILD_ID && nh->n_namesz==4 &&
+	 memcmp(base+name,"GNU",4)==0 &&
+	 nh->n_descsz<=sizeof(key.build_id)){
+	key.build_id_length=nh->n_descsz;
+	memcpy(key.build_id,base+desc,nh->n_descsz);
+	return true;
+      }
+      n=next;
+    }
+  }
+  return false;
+}
+
+// What identifies this version of binary. False if it can't be read.
+static bool binary_key_of( const std::string &binary, binary_key &key){
+  int fd=open(binary.c_str(),O_RDONLY);
+  if(fd<0)
+    return false;
+  struct stat st;
+  if(fstat(fd,&st)!=0){
+    close(fd);
+    return false;
+  }
+  key=binary_key();
+  key.mtime_sec=st.st_mtim.tv_sec;
+  key.mtime_nsec=st.st_mtim.tv_nsec;
+  key.size=st.st_size;
+  if(st.st_size>=EI_NIDENT){
+    void *m=mmap(nullptr,st.st_size,PROT_READ,MAP_PRIVATE,fd,0);
+    if(m!=MAP_FAILED){
+      auto base=static_cast<const unsigned char*>(m);
+      if(memcmp(base,ELFMAG,SELFMAG)==0){
+	if(base[EI_CLASS]==ELFCLASS64)
+	  find_build_id<Elf64_Ehdr,Elf64_Phdr>(base,st.st_size,key);
+	else if(base[EI_CLASS]==ELFCLASS32)
+	  find_build_id<Elf32_Ehdr,Elf32_Phdr>(base,st.st_size,key);
+      }
+      munmap(m,st.st_size);
+    }
+  }
+  close(fd);
+  return true;
+}
+
+static size_t cache_padded( size_t n){ return (n+7)&~size_t(7);}
+
+static bool save_cache( const program_info &prog, const std::string &path,
+			const binary_key &key){
+  cache_header h={};
+  memcpy(h.magic,CACHE_MAGIC,sizeof(h.magic));
+  h.version=CACHE_VERSION;
+  h.key=key;
+  h.nstrings=prog.strings.size();
+  h.nmodules=prog.modules.size();
+  h.nstmts=prog.stmts.size();
+  h.nfuncs=prog.funcs.size();
+  h.nvars=prog.vars.size();
+  h.nranges=prog.ranges.size();
+
+  // write it somewhere else first so a reader never sees half a cache
+  std::string tmp=path+".tmp"+std::to_string(getpid());
+  std::ofstream out(tmp, std::ios::binary);
+  if(out.fail())
+    return false;
+  static const char zeros[8]={};
+  auto write_table=[&out](const void *data, size_t bytes){
+    out.write(static_cast<const char*>(data),bytes);
+    out.write(zeros,cache_padded(bytes)-bytes);
+  };
+  write_table(&h,sizeof(h));
+  write_table(prog.strings.data,prog.strings.size());
+  write_table(prog.modules.data,prog.modules.size()*sizeof(module_rec));
+  write_table(prog.stmts.data,prog.stmts.size()*sizeof(stmt_rec));
+  write_table(prog.funcs.data,prog.funcs.size()*sizeof(func_rec));
+  write_table(prog.vars.data,prog.vars.size()*sizeof(var_rec));
+  write_table(prog.ranges.data,prog.ranges.size()*sizeof(range_rec));
+  out.close();
+  if(out.fail() || rename(tmp.c_str(),path.c_str())!=0){
+    unlink(tmp.c_str());
+    return false;
+  }
+  return true;
+}
+
+/* Whether every reference between prog's tables and into its strings is in
+   range, so that a damaged cache can't send the tools off the end of them. */
+static bool tables_consistent( const program_info &prog){
+  auto str_ok=[&prog](str_ref r){
+    return uint64_t(r.offset)+r.length <= prog.strings.size();};
+  auto span_ok=[](uint64_t first, uint64_t n, size_t size){
+    return first+n <= size;};
+  for( auto &m: prog.modules)
+    if(!str_ok(m.name) || !span_ok(m.first_stmt,m.nstmts,prog.stmts.size()))
+      return false;
+  for( auto &s: prog.stmts)
+    if(!str_ok(s.file))
+      return false;
+  for( auto &f: prog.funcs)
+    if(!str_ok(f.name) || f.module>=prog.modules.size() ||
+       !span_ok(f.first_var,f.nvars,prog.vars.size()))
+      return false;
+  for( auto &v: prog.vars)
+    if(!str_ok(v.name) || !str_ok(v.file) || !str_ok(v.type_name) ||
+       v.func>=prog.funcs.size() ||
+       !span_ok(v.first_range,v.nranges,prog.ranges.size()))
+      return false;
+  return true;
+}
+
+/* Point prog's tables into the cache at path. False if there is no cache
+   there, it was made from some other version of the binary or it has been
+   damaged, and then it gets rebuilt. */
+static bool load_cache( program_info &prog, const std::string &path,
+			const binary_key &key){
+  int fd=open(path.c_str(),O_RDONLY);
+  if(fd<0)
+    return false;
+  struct stat st;
+  if(fstat(fd,&st)!=0 || size_t(st.st_size)<sizeof(cache_header)){
+    close(fd);
+    return false;
+  }
+  void *m=mmap(nullptr,st.st_size,PROT_READ,MAP_PRIVATE,fd,0);
+  close(fd);
+  if(m==MAP_FAILED)
+    return false;
+  auto base=static_cast<const char*>(m);
+  auto h=reinterpret_cast<const cache_header*>(base);
+  if(memcmp(h->magic,CACHE_MAGIC,sizeof(h->magic))!=0 ||
+     h->version!=CACHE_VERSION || !(h->key==key)){
+    munmap(m,st.st_size);
+    return false;
+  }
+  size_t at=cache_padded(sizeof(cache_header));
+  bool fits=true;
+  auto place=[&](auto &t, uint64_t count){
+    typedef typename std::remove_const<
+      typename std::remove_pointer<decltype(t.data)>::type>::type rec;
+    if(count>(size_t(st.st_size)-at)/sizeof(rec)){
+      fits=false;
+      return;
+    }
+    t.data=reinterpret_cast<const rec*>(base+at);
+    t.count=count;
+    at+=cache_padded(count*sizeof(rec));
+  };
+  place(prog.strings,h->nstrings);
+  place(prog.modules,h->nmodules);
+  place(prog.stmts,h->nstmts);
+  place(prog.funcs,h->nfuncs);
+  place(prog.vars,h->nvars);
+  place(prog.ranges,h->nranges);
+  if(!fits || at!=size_t(st.st_size) || !tables_consistent(prog)){
+    // leave nothing pointing into the mapping
+    prog.strings=table<char>();
+    prog.modules=table<module_rec>();
+    prog.stmts=table<stmt_rec>();
+    prog.funcs=table<func_rec>();
+    prog.vars=table<var_rec>();
+    prog.ranges=table<range_rec>();
+    munmap(m,st.st_size);
+    return false;
+  }
+  prog.keep_mapping(m,st.st_size);
+  return true;
+}
+
+// The directories in path that don't exist yet are made.
+static void make_dirs( const std::string &path){
+  for(size_t slash=path.find('/',1); ; slash=path.find('/',slash+1)){
+    mkdir(path.substr(0,slash).c_str(),0777);
+    if(slash==std::string::npos)
+      return;
+  }
+}
+
+/* Where the cache for binary could be, in the order to try them. Without a
+   cache dir that is next to the binary and then in the user's cache dir. */
+static std::vector<std::string> cache_paths( const std::string &binary,
+					     const binary_key &key,
+					     const cache_options &opts){
+  std::string base=binary.substr(binary.rfind('/')+1);
+  std::string id;
+  if(key.build_id_length!=0){
+    static const char hexdigits[]="0123456789abcdef";
+    for(unsigned i=0;i<key.build_id_length;i++){
+      id+=hexdigits[key.build_id[i]>>4];
+      id+=hexdigits[key.build_id[i]&0xf];
+    }
+  } else {
+    char real[PATH_MAX];
+    id=std::to_string(std::hash<std::string>()
+		      (realpath(binary.c_str(),real) ? real : binary));
+  }
+  std::string name=base+'-'+id+CACHE_SUFFIX;
+  if(!opts.dir.empty())
+    return {opts.dir+'/'+name};
+  std::vector<std::string> paths={binary+CACHE_SUFFIX};
+  if(getenv("XDG_CACHE_HOME")!=nullptr)
+    paths.push_back(std::string(getenv("XDG_CACHE_HOME"))+"/dwqual/"+name);
+  else if(getenv("HOME")!=nullptr)
+    paths.push_back(std::string(getenv("HOME"))+"/.cache/dwqual/"+name);
+  return paths;
+}
+
+enum load_status {
+		  LOAD_OK=0,
+		  LOAD_NOFILE=1,
+		  LOAD_NOFUNCS=2
+};
+
+// Count what was loaded into prog
+static void count_program( const program_info &prog, run_stats &stats){
+  stats.count("modules",prog.modules.size());
+  stats.count("statements",prog.stmts.size());
+  stats.count("functions",prog.funcs.size());
+  stats.count("variables",prog.vars.size());
+  stats.count("location list entries",prog.ranges.size());
+}
+
+/* Fill prog for binary, from its cache when there is a current one and
+   otherwise by parsing it with Symtab and then saving the cache. A cache has
+   the whole binary in it so it is used whatever the filter is, and the
+   callers still have to pick out what the filter selects. Without one only
+   what the filter selects is parsed, and that isn't saved. */
+static load_status load_program( program_info &prog,
+				 const std::string &binary,
+				 const cache_options &opts, int jobs,
+				 run_stats &stats,
+				 const program_filter &filter){
+  binary_key key;
+  bool cacheable=opts.use && binary_key_of(binary,key);
+  std::vector<std::string> paths;
+  if(cacheable){
+    paths=cache_paths(binary,key,opts);
+    if(!opts.rebuild)
+      for( auto &p: paths)
+	if(load_cache(prog,p,key)){
+	  stats.phase("cache load");
+	  count_program(prog,stats);
+	  return prog.funcs.size()==0 ? LOAD_NOFUNCS : LOAD_OK;
+	}
+  }
+  stats.phase("cache load");
+
+  Dyninst::SymtabAPI::Symtab *obj = NULL;
+  // Parse the object file
+  if(!Dyninst::SymtabAPI::Symtab::openFile(obj, binary))
+    return LOAD_NOFILE;
+  stats.phase("Symtab::openFile");
+  if(!prog.read_symtab(obj,jobs,stats,filter))
+    return LOAD_NOFUNCS;
+  count_program(prog,stats);
+
+  if(cacheable && filter.empty()){
+    for( auto &p: paths){
+      if(p.rfind('/')!=std::string::npos)
+	make_dirs(p.substr(0,p.rfind('/')));
+      if(save_cache(prog,p,key))
+	break;
+    }
+    stats.phase("cache save");
+  }
+  return LOAD_OK;
+}
+
+#endif
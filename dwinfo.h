@@ -0,0 +1,465 @@
+#ifndef DWQUAL_DWINFO_H
+#define DWQUAL_DWINFO_H
+
+#include <string>
+#include <string_view>
+#include <vector>
+#include <map>
+#include <regex>
+#include <algorithm>
+#include <type_traits>
+#include <cstdint>
+#include <cerrno>
+#include <cctype>
+#include <cstdlib>
+
+#include <fnmatch.h>
+#include <sys/mman.h>
+
+#include <dyninst/Symtab.h>
+#include <dyninst/Function.h>
+#include <dyninst/Variable.h>
+#include <dyninst/Type.h>
+
+#include "parallel.h"
+#include "stats.h"
+
+/* Everything linemap and whichvars need from the DWARF, pulled out of Symtab
+   once and kept in flat tables of plain records. The records refer to each
+   other by index and to their text through the string table, so the tables
+   can be written to a cache file as they are and used straight out of an
+   mmap of it later. */
+
+struct str_ref{
+  uint32_t offset;
+  uint32_t length;
+};
+
+struct module_rec{
+  str_ref name;
+  uint32_t first_stmt; // into stmts
+  uint32_t nstmts;
+  uint32_t lang_unknown;
+  uint32_t pad;
+};
+
+// One entry of a module's line table covering [start,end)
+struct stmt_rec{
+  uint64_t start;
+  uint64_t end;
+  str_ref file;
+  uint32_t line;
+  uint32_t column;
+};
+
+struct func_rec{
+  uint64_t offset;
+  uint64_t size;
+  str_ref name;
+  uint32_t module; // into modules
+  uint32_t first_var; // into vars, the parameters come first
+  uint32_t nvars;
+};
+
+struct var_rec{
+  str_ref name;
+  str_ref file;
+  str_ref type_name;
+  int32_t line;
+  uint32_t func; // into funcs
+  uint32_t first_range; // into ranges
+  uint32_t nranges;
+};
+
+// A location list entry exactly as the DWARF gave it, [low,high] inclusive
+struct range_rec{
+  uint64_t lowPC;
+  uint64_t hiPC;
+};
+
+/* Which part of a binary to look at: the functions from the modules whose
+   source file matches a glob, whose names the regex finds and which overlap
+   the address range [low,high]. Any of them can be left out and an empty
+   filter selects everything. */
+class program_filter{
+  std::string glob;
+  std::regex func_re;
+  bool have_func_re=false;
+  uint64_t low=0, high=UINT64_MAX;
+public:
+  bool empty() const {
+    return glob.empty() && !have_func_re && low==0 && high==UINT64_MAX;
+  }
+  bool has_file_glob() const { return !glob.empty();}
+  bool has_address_range() const { return low!=0 || high!=UINT64_MAX;}
+  uint64_t range_low() const { return low;}
+  uint64_t range_high() const { return high;}
+  void set_file_glob(const std::string &g){ glob=g;}
+  // False if re isn't a regular expression
+  bool set_function_regex(const std::string &re){
+    try {
+      func_re=std::regex(re, std::regex::extended|std::regex::optimize);
+    } catch (const std::regex_error &){
+      return false;
+    }
+    have_func_re=true;
+    return true;
+  }
+  // low-high or just low, both in hex. False if it can't be read.
+  bool set_address_range(const std::string &range){
+    // strtoull would skip spaces and take a minus sign, wrapping the value
+    auto read_hex=[](const char *from, char *&end, uint64_t &value){
+      if(!isxdigit(static_cast<unsigned char>(*from)))
+	return false;
+      errno=0;
+      value=strtoull(from,&end,16);
+      return errno!=ERANGE;
+    };
+    char *end;
+    if(!read_hex(range.c_str(),end,low))
+      return false;
+    if(*end=='\0'){
+      high=low;
+      return true;
+    }
+    if(*end!='-' || !read_hex(end+1,end,high))
+      return false;
+    return *end=='\0' && low<=high;
+  }
+  bool match_file(const std::string &file) const {
+    return glob.empty() || fnmatch(glob.c_str(),file.c_str(),0)==0;
+  }
+  bool match_function(const std::string &module, const std::string &name,
+		      uint64_t offset, uint64_t size) const {
+    // a function of size 0 is taken to hold its own address
+    return match_file(module) && offset<=high &&
+      offset+std::max<uint64_t>(size,1)>low &&
+      (!have_func_re || std::regex_search(name,func_re));
+  }
+};
+
+template<typename T>
+struct table{
+  static_assert(std::is_trivially_copyable<T>::value,
+		"tables are written to disk as they are");
+  const T *data=nullptr;
+  size_t count=0;
+  const T &operator[](size_t i) const { return data[i];}
+  size_t size() const { return count;}
+  const T *begin() const { return data;}
+  const T *end() const { return data+count;}
+};
+
+class program_info{
+  // the storage behind the tables when they were filled from Symtab
+  std::vector<char> string_store;
+  std::vector<module_rec> module_store;
+  std::vector<stmt_rec> stmt_store;
+  std::vector<func_rec> func_store;
+  std::vector<var_rec> var_store;
+  std::vector<range_rec> range_store;
+  // or the mapping behind them when they came from a cache file
+  void *map_base=nullptr;
+  size_t map_size=0;
+
+  std::map< std::string, str_ref> interned;
+  str_ref intern(const std::string &s);
+  void point_at_storage();
+public:
+  table<char> strings;
+  table<module_rec> modules;
+  table<stmt_rec> stmts;
+  table<func_rec> funcs;
+  table<var_rec> vars;
+  table<range_rec> ranges;
+
+  program_info(){}
+  program_info(const program_info &)=delete;
+  program_info &operator=(const program_info &)=delete;
+  ~program_info(){
+    if(map_base!=nullptr)
+      munmap(map_base,map_size);
+  }
+
+  // take over a mapping which the tables have been pointed into
+  void keep_mapping(void *base, size_t size){
+    map_base=base;
+    map_size=size;
+  }
+  std::string_view str(str_ref r) const {
+    return std::string_view(strings.data+r.offset,r.length);
+  }
+  /* Pull the functions, their variables and location lists and the line
+     tables of all the modules out of obj, using jobs threads. With a filter
+     only the functions it selects and the modules they are in are read.
+     Returns false if there are no functions. */
+  bool read_symtab(Dyninst::SymtabAPI::Symtab *obj, int jobs,
+		   run_stats &stats,
+		   const program_filter &filter);
+  // Whether filter selects the function f
+  bool selects(const program_filter &filter, const func_rec &f) const {
+    return filter.empty() ||
+      filter.match_function(std::string(str(modules[f.module].name)),
+			    std::string(str(f.name)), f.offset, f.size);
+  }
+};
+
+inline str_ref program_info::intern(const std::string &s){
+  auto i=interned.find(s);
+  if(i!=interned.end())
+    return i->second;
+  str_ref r;
+  r.offset=string_store.size();
+  r.length=s.size();
+  string_store.insert(string_store.end(),s.begin(),s.end());
+  interned[s]=r;
+  return r;
+}
+
+inline void program_info::point_at_storage(){
+  strings.data=string_store.data();
+  strings.count=string_store.size();
+  modules.data=module_store.data();
+  modules.count=module_store.size();
+  stmts.data=stmt_store.data();
+  stmts.count=stmt_store.size();
+  funcs.data=func_store.data();
+  funcs.count=func_store.size();
+  vars.data=var_store.data();
+  vars.count=var_store.size();
+  ranges.data=range_store.data();
+  ranges.count=range_store.size();
+}
+
+/* The functions overlapping [low,high]: the one holding low and the ones
+   starting in the range, found by a search of all the functions sorted by
+   where they start. Nothing else is looked up for the ones outside it. */
+inline void functions_in_range(Dyninst::SymtabAPI::Symtab *obj,
+			       uint64_t low, uint64_t high,
+			       std::vector<Dyninst::SymtabAPI::Function *> &funcs){
+  using namespace Dyninst::SymtabAPI;
+  std::vector <Function *> all;
+  obj->getAllFunctions(all);
+  auto by_start=[](Function *a, Function *b){
+		  return a->getOffset() < b->getOffset();};
+  std::sort(all.begin(),all.end(),by_start);
+  // a function starting before the range can still reach into it
+  Function *f;
+  if(obj->getContainingFunction(low,f) && f->getOffset()<low)
+    funcs.push_back(f);
+  auto i=std::lower_bound(all.begin(),all.end(),low,
+			  [](Function *a, uint64_t at){
+			    return a->getOffset() < at;});
+  for( ;i!=all.end() && (*i)->getOffset()<=high;i++)
+    funcs.push_back(*i);
+}
+
+inline bool program_info::read_symtab(Dyninst::SymtabAPI::Symtab *obj,
+				      int jobs, run_stats &stats,
+				      const program_filter &filter){
+  using namespace Dyninst::SymtabAPI;
+  std::vector <Function *> all_funcs;
+  std::vector <Module *> all_mods;
+  if(filter.empty()){
+    if (!obj->getAllFunctions(all_funcs))
+      return false;
+    obj->getAllModules(all_mods);
+  } else {
+    // only the functions of the matching modules or in the address range
+    // are looked at, and only the modules which the selected functions are
+    // in get parsed below
+    if(filter.has_file_glob()){
+      std::vector <Module *> mods;
+      obj->getAllModules(mods);
+      for( auto m: mods)
+	if(filter.match_file(m->fullName()))
+	  m->getAllFunctions(all_funcs);
+    } else if(filter.has_address_range())
+      functions_in_range(obj, filter.range_low(), filter.range_high(),
+			 all_funcs);
+    else
+      obj->getAllFunctions(all_funcs);
+    all_funcs.erase(std::remove_if(all_funcs.begin(),all_funcs.end(),
+				   [&filter](Function *f){
+				     return !filter.match_function(
+						f->getModule()->fullName(),
+						f->getName(), f->getOffset(),
+						f->getSize());}),
+		    all_funcs.end());
+    if(all_funcs.empty())
+      return false;
+  }
+  std::map< Module*, uint32_t> mod_index;
+  for(size_t n=0;n<all_mods.size();n++)
+    mod_index[all_mods[n]]=n;
+  for( auto f: all_funcs)
+    if(mod_index.insert(std::make_pair(f->getModule(),all_mods.size())).second)
+      all_mods.push_back(f->getModule());
+  stats.phase("getAllFunctions");
+
+  // the DWARF gets parsed here, so do it in parallel keeping everything as
+  // strings and then intern it all in order afterwards.
+  struct var_text{
+    std::string name,file,type_name;
+    int line;
+    std::vector<range_rec> ranges;
+  };
+  std::vector< std::vector<Statement::Ptr> > mod_stmts(all_mods.size());
+  parallel_over(all_mods.size(), jobs,
+		[&](size_t n){ all_mods[n]->getStatements(mod_stmts[n]);});
+  stats.phase("getStatements");
+  std::vector< std::vector<var_text> > func_vars(all_funcs.size());
+  parallel_over(all_funcs.size(), jobs,
+		[&](size_t n){
+		  std::vector <localVar *> lvars;
+		  all_funcs[n]->getParams(lvars);
+		  all_funcs[n]->getLocalVariables(lvars);
+		  for( auto j: lvars){
+		    var_text v;
+		    v.name=j->getName();
+		    v.file=j->getFileName();
+		    if(j->getType()!=nullptr)
+		      v.type_name=j->getType()->getName();
+		    v.line=j->getLineNum();
+		    for( auto &k: j->getLocationLists())
+		      v.ranges.push_back(range_rec{k.lowPC,k.hiPC});
+		    func_vars[n].push_back(v);
+		  }});
+  stats.phase("location lists");
+
+  for(size_t n=0;n<all_mods.size();n++){
+    module_rec m;
+    m.name=intern(all_mods[n]->fullName());
+    m.first_stmt=stmt_store.size();
+    m.nstmts=mod_stmts[n].size();
+    m.lang_unknown= all_mods[n]->language() == lang_Unknown;
+    m.pad=0;
+    for( auto &s: mod_stmts[n])
+      stmt_store.push_back(stmt_rec{s->startAddr(), s->endAddr(),
+				    intern(s->getFile()), s->getLine(),
+				    s->getColumn()});
+    module_store.push_back(m);
+  }
+  for(size_t n=0;n<all_funcs.size();n++){
+    func_rec f;
+    f.offset=all_funcs[n]->getOffset();
+    f.size=all_funcs[n]->getSize();
+    f.name=intern(all_funcs[n]->getName());
+    f.module=mod_index[all_funcs[n]->getModule()];
+    f.first_var=var_store.size();
+    f.nvars=func_vars[n].size();
+    for( auto &v: func_vars[n]){
+      var_rec r;
+      r.name=intern(v.name);
+      r.file=intern(v.file);
+      r.type_name=intern(v.type_name);
+      r.line=v.line;
+      r.func=n;
+      r.first_range=range_store.size();
+      r.nranges=v.ranges.size();
+      range_store.insert(range_store.end(),v.ranges.begin(),v.ranges.end());
+      var_store.push_back(r);
+    }
+    func_store.push_back(f);
+  }
+  interned.clear();
+  point_at_storage();
+  stats.phase("DWARF tables");
+  return true;
+}
+
+/* A module's line table flattened into disjoint address segments. Each
+   segment carries the statements which cover every address in it, in the
+   order the module gave them. This lets an address interval be matched to
+   source lines by walking the segments it overlaps rather than looking up
+   the lines of each byte. */
+struct line_segment{
+  uint64_t lower; // inclusive
+  uint64_t upper; // exclusive
+  std::vector<uint32_t> stmts; // into program_info::stmts
+};
+
+struct line_table{
+  std::vector<line_segment> segments; // sorted by address and disjoint
+  line_table(){}
+  line_table(const program_info &prog, uint32_t module);
+  // the segment containing pc or nullptr if no statement covers it
+  const line_segment *find(uint64_t pc) const {
+    auto seg=std::upper_bound(segments.begin(),segments.end(),pc,
+			      [](uint64_t a, const line_segment &s){
+				return a < s.upper;});
+    if(seg==segments.end() || seg->lower > pc)
+      return nullptr;
+    return &*seg;
+  }
+};
+
+inline line_table::line_table(const program_info &prog, uint32_t module){
+  auto &mod=prog.modules[module];
+  auto stmt=[&prog,&mod](uint32_t n) -> const stmt_rec & {
+    return prog.stmts[mod.first_stmt+n];};
+  // every address where the set of covering statements may change
+  std::vector<uint64_t> bounds;
+  for(uint32_t n=0;n<mod.nstmts;n++)
+    if(stmt(n).start < stmt(n).end){
+      bounds.push_back(stmt(n).start);
+      bounds.push_back(stmt(n).end);
+    }
+  std::sort(bounds.begin(),bounds.end());
+  bounds.erase(std::unique(bounds.begin(),bounds.end()),bounds.end());
+  if(bounds.empty())
+    return;
+
+  // statements ordered by where they start
+  std::vector<uint32_t> by_start(mod.nstmts);
+  for(uint32_t n=0;n<mod.nstmts;n++)
+    by_start[n]=n;
+  std::stable_sort(by_start.begin(),by_start.end(),
+		   [&stmt](uint32_t a, uint32_t b){
+		     return stmt(a).start < stmt(b).start;});
+
+  // sweep the boundaries keeping the covering statements in table order
+  std::vector<uint32_t> active;
+  auto next=by_start.begin();
+  for(size_t b=0;b+1<bounds.size();b++){
+    uint64_t lower=bounds[b];
+    active.erase(std::remove_if(active.begin(),active.end(),
+				[&stmt,lower](uint32_t a){
+				  return stmt(a).end <= lower;}),
+		 active.end());
+    bool added=false;
+    for( ;next!=by_start.end() && stmt(*next).start<=lower; next++)
+      if(stmt(*next).start < stmt(*next).end){
+	active.push_back(*next);
+	added=true;
+      }
+    if(added)
+      std::sort(active.begin(),active.end());
+    if(active.empty())
+      continue;
+    line_segment seg;
+    seg.lower=lower;
+    seg.upper=bounds[b+1];
+    for( auto a: active)
+      seg.stmts.push_back(mod.first_stmt+a);
+    segments.push_back(seg);
+  }
+}
+
+/* The line tables of the modules which the functions funcs are in, indexed
+   like program_info::modules. The other modules' tables are left empty. */
+inline std::vector<line_table> build_line_tables(const program_info &prog,
+					 const std::vector<uint32_t> &funcs,
+					 int jobs){
+  std::vector<uint32_t> mods;
+  for( auto f: funcs)
+    mods.push_back(prog.funcs[f].module);
+  std::sort(mods.begin(),mods.end());
+  mods.erase(std::unique(mods.begin(),mods.end()),mods.end());
+  std::vector<line_table> tables(prog.modules.size());
+  parallel_over(mods.size(), jobs,
+		[&](size_t n){ tables[mods[n]]=line_table(prog,mods[n]);});
+  return tables;
+}
+
+#endif
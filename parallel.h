@@ -0,0 +1,46 @@
+#ifndef DWQUAL_PARALLEL_H
+#define DWQUAL_PARALLEL_H
+
+#include <cstddef>
+#include <algorithm>
+
+#include <tbb/task_arena.h>
+#include <tbb/parallel_for.h>
+#include <tbb/blocked_range.h>
+#include <tbb/parallel_sort.h>
+
+/* Call body(i) for every i in [0,n). With jobs==1 this is a plain loop on
+   the calling thread, otherwise the calls are spread over jobs threads (all
+   the available ones when jobs<=0 or there aren't that many cores) and may
+   happen in any order. */
+template<typename Body>
+void parallel_over( size_t n, int jobs, const Body &body){
+  if(jobs==1){
+    for(size_t i=0;i<n;i++)
+      body(i);
+    return;
+  }
+  if(jobs<=0 || jobs>tbb::this_task_arena::max_concurrency())
+    jobs=tbb::task_arena::automatic;
+  tbb::task_arena arena(jobs);
+  arena.execute([&]{
+		  tbb::parallel_for(tbb::blocked_range<size_t>(0,n),
+				    [&](const tbb::blocked_range<size_t> &r){
+				      for(size_t i=r.begin();i!=r.end();i++)
+					body(i);});});
+}
+
+// Sort [first,last) by less, spread over jobs threads like parallel_over.
+template<typename Iter, typename Less>
+void sort_over( Iter first, Iter last, int jobs, const Less &less){
+  if(jobs==1){
+    std::sort(first,last,less);
+    return;
+  }
+  if(jobs<=0 || jobs>tbb::this_task_arena::max_concurrency())
+    jobs=tbb::task_arena::automatic;
+  tbb::task_arena arena(jobs);
+  arena.execute([&]{ tbb::parallel_sort(first,last,less);});
+}
+
+#endif
@@ -0,0 +1,98 @@
+#ifndef DWQUAL_STATS_H
+#define DWQUAL_STATS_H
+
+#include <string>
+#include <vector>
+#include <chrono>
+#include <ostream>
+#include <iomanip>
+#include <cstdint>
+
+#include <sys/resource.h>
+
+/* What --stats reports: the wall time of each phase of a run with the peak
+   RSS when it finished, and counters of how much work was done. A phase
+   runs from the end of the one before it, and phases or counters with the
+   same name, such as the phases done once per binary, are added together.
+   Nothing is kept unless it has been enabled. */
+class run_stats{
+  struct phase_time{
+    std::string name;
+    double seconds;
+    long peak_rss; // KB
+  };
+  struct counter{
+    std::string name;
+    uint64_t count;
+  };
+  bool enabled=false;
+  std::chrono::steady_clock::time_point start, last;
+  std::vector<phase_time> phases;
+  std::vector<counter> counters;
+
+  static long peak_rss(){
+    struct rusage ru;
+    getrusage(RUSAGE_SELF,&ru);
+    return ru.ru_maxrss;
+  }
+public:
+  void enable(){
+    enabled=true;
+    start=last=std::chrono::steady_clock::now();
+  }
+  bool on() const { return enabled;}
+
+  // The phase called name has just finished
+  void phase(const std::string &name){
+    if(!enabled)
+      return;
+    auto now=std::chrono::steady_clock::now();
+    double seconds=std::chrono::duration<double>(now-last).count();
+    last=now;
+    for( auto &p: phases)
+      if(p.name==name){
+	p.seconds+=seconds;
+	p.peak_rss=peak_rss();
+	return;
+      }
+    phases.push_back(phase_time{name,seconds,peak_rss()});
+  }
+
+  void count(const std::string &name, uint64_t n){
+    if(!enabled)
+      return;
+    for( auto &c: counters)
+      if(c.name==name){
+	c.count+=n;
+	return;
+      }
+    counters.push_back(counter{name,n});
+  }
+
+  void print(std::ostream &os) const {
+    if(!enabled)
+      return;
+    auto flags=os.flags();
+    os << std::dec << std::left << std::setw(32) << "Phase" << std::right
+       << std::setw(12) << "Wall s" << std::setw(16) << "Peak RSS KB"
+       << std::endl << std::fixed << std::setprecision(4);
+    for( auto &p: phases)
+      os << std::left << std::setw(32) << p.name << std::right
+	 << std::setw(12) << p.seconds << std::setw(16) << p.peak_rss
+	 << std::endl;
+    os << std::left << std::setw(32) << "Total" << std::right
+       << std::setw(12)
+       << std::chrono::duration<double>(std::chrono::steady_clock::now()
+					-start).count()
+       << std::setw(16) << peak_rss() << std::endl;
+    if(!counters.empty())
+      os << std::endl << std::left << std::setw(32) << "Counter"
+	 << std::right << std::setw(12) << "Count" << std::endl;
+    for( auto &c: counters)
+      os << std::left << std::setw(32) << c.name << std::right
+	 << std::setw(12) << c.count << std::endl;
+    os.flags(flags);
+  }
+};
+
+#endif
@@ -0,0 +1,222 @@
+#ifndef DWQUAL_VARMAP_H
+#define DWQUAL_VARMAP_H
+
+#include <vector>
+#include <algorithm>
+#include <cstdint>
+
+#include "parallel.h"
+
+/* The variables available at each address. The location list ranges of the
+   variables are gathered with add() and then build() sorts where they start
+   and end and sweeps over them once, cutting the address space into the
+   maximal disjoint intervals over which the set of available variables stays
+   the same. This is what an interval_map<Address,set<var>> would hold after
+   adding each range to it, without splitting and copying sets at every
+   overlap as each range goes in. The sets of all the intervals are kept one
+   after another in a single vector. */
+
+struct var_interval{
+  /* Where a range starts the interval is closed at that address. Where it
+     begins or ends only because some other range ended, it is open at the
+     address of that range's end. Where one range ends at x-1 and another
+     starts at x interval_map's bounds depend on the order the ranges were
+     added, and build() works them out the same way. first() and last() are
+     the same whatever the bounds. */
+  uint64_t lower;
+  uint64_t upper;
+  uint32_t first_var; // into var_map's set storage
+  uint32_t nvars;
+  bool open_lower;
+  bool open_upper;
+  uint64_t first() const { return open_lower ? lower+1 : lower;}
+  uint64_t last() const { return open_upper ? upper-1 : upper;}
+};
+
+// The variables of one interval, in increasing order
+struct var_set{
+  const uint32_t *b;
+  const uint32_t *e;
+  const uint32_t *begin() const { return b;}
+  const uint32_t *end() const { return e;}
+  size_t size() const { return e-b;}
+  uint32_t front() const { return *b;}
+};
+
+class var_map{
+  struct range{
+    uint64_t low;
+    uint64_t high;
+    uint32_t var;
+  };
+  // a range starting at at, or ending just before it
+  struct event{
+    uint64_t at;
+    uint32_t var;
+    uint32_t starts;
+  };
+  // where ranges end at at-1 and others start at at, before intervals[next]
+  struct tie{
+    uint64_t at;
+    size_t next;
+  };
+  std::vector<range> ranges; // in the order they were added
+  uint32_t var_count=0; // one more than the largest var added
+  std::vector<var_interval> intervals;
+  std::vector<uint32_t> sets;
+  void settle_ties(const std::vector<tie> &ties);
+public:
+  /* var is available in [low,high]. high must be below the largest address.
+     The bounds at ties depend on the order the ranges are added in, so
+     they have to be added in the same order every run, not from threads. */
+  void add(uint64_t low, uint64_t high, uint32_t var){
+    if(low>high)
+      return;
+    ranges.push_back(range{low,high,var});
+    var_count=std::max(var_count,var+1);
+  }
+  // Work out the intervals from everything added, sorting with jobs threads.
+  void build(int jobs);
+
+  const var_interval *begin() const { return intervals.data();}
+  const var_interval *end() const { return intervals.data()+intervals.size();}
+  size_t size() const { return intervals.size();}
+  var_set vars(const var_interval &i) const {
+    return var_set{sets.data()+i.first_var, sets.data()+i.first_var+i.nvars};
+  }
+};
+
+inline void var_map::build(int jobs){
+  std::vector<event> events;
+  events.reserve(2*ranges.size());
+  for( auto &r: ranges){
+    events.push_back(event{r.low,r.var,1});
+    events.push_back(event{r.high+1,r.var,0});
+  }
+  sort_over(events.begin(), events.end(), jobs,
+	    [](const event &a, const event &b){ return a.at < b.at;});
+  intervals.clear();
+  sets.clear();
+  // how many of each var's ranges cover the current address
+  std::vector<uint32_t> live(var_count,0);
+  std::vector<uint32_t> active; // the vars with any live, in order
+  bool open=false; // intervals.back() reaches the current address
+  std::vector<tie> ties;
+  for(size_t e=0;e<events.size();){
+    uint64_t at=events[e].at;
+    bool started=false, ended=false;
+    for( ;e<events.size() && events[e].at==at;e++){
+      auto &ev=events[e];
+      auto pos=std::lower_bound(active.begin(),active.end(),ev.var);
+      if(ev.starts){
+	started=true;
+	if(live[ev.var]++==0)
+	  active.insert(pos,ev.var);
+      } else {
+	ended=true;
+	if(--live[ev.var]==0)
+	  active.erase(pos);
+      }
+    }
+    if(open){
+      auto &cur=intervals.back();
+      if(cur.nvars==active.size() &&
+	 std::equal(active.begin(),active.end(),sets.begin()+cur.first_var))
+	continue; // the ranges ending here are carried on by others
+      cur.open_upper=!ended;
+      cur.upper= ended ? at-1 : at;
+    }
+    if(open && started && ended && !active.empty())
+      ties.push_back(tie{at,intervals.size()});
+    open=!active.empty();
+    if(open){
+      var_interval i;
+      i.open_lower=!started;
+      i.lower= started ? at : at-1;
+      i.upper=0;
+      i.open_upper=false;
+      i.first_var=sets.size();
+      i.nvars=active.size();
+      sets.insert(sets.end(),active.begin(),active.end());
+      intervals.push_back(i);
+    }
+  }
+  std::vector<event>().swap(events);
+  settle_ties(ties);
+  std::vector<range>().swap(ranges);
+}
+
+/* The sweep closes both sides of a tie. interval_map instead keeps the bounds
+   from the range which first split the two sides apart, or which first
+   joined them if only one side was covered, and keeps them until the two
+   sides end up with the same variables again. So the ranges covering each
+   side of each tie are played back in the order they were added, keeping
+   track of which variables each side has got. */
+inline void var_map::settle_ties(const std::vector<tie> &ties){
+  if(ties.empty())
+    return;
+  // which side of the tie a range covers
+  enum : uint8_t { BEFORE=1, AFTER=2, BOTH=3 };
+  struct touch{
+    uint32_t var;
+    uint8_t side;
+  };
+  // the ranges touching each tie, in the order they were added
+  auto touched=[&ties](const range &r, auto f){
+    auto t=std::lower_bound(ties.begin(),ties.end(),r.low,
+			    [](const tie &a, uint64_t at){ return a.at < at;});
+    for( ;t!=ties.end() && t->at<=r.high+1;t++)
+      f(t-ties.begin(), t->at==r.low ? AFTER : t->at==r.high+1 ? BEFORE
+	: BOTH);
+  };
+  std::vector<size_t> first(ties.size()+1,0);
+  for( auto &r: ranges)
+    touched(r,[&first](size_t t, uint8_t){ first[t+1]++;});
+  for(size_t t=0;t<ties.size();t++)
+    first[t+1]+=first[t];
+  std::vector<touch> touches(first.back());
+  std::vector<size_t> fill(first.begin(),first.end()-1);
+  for( auto &r: ranges)
+    touched(r,[&](size_t t, uint8_t side){
+		touches[fill[t]++]=touch{r.var,side};});
+
+  std::vector<uint8_t> sides(var_count,0);
+  for(size_t t=0;t<ties.size();t++){
+    // how many vars are before, after and on just one side
+    size_t before=0, after=0, one=0;
+    enum { CLOSED, OPEN_UPPER, OPEN_LOWER } bounds=CLOSED;
+    for(size_t n=first[t];n<first[t+1];n++){
+      auto &h=touches[n];
+      bool had_before=before!=0, had_after=after!=0;
+      bool apart=had_before && had_after && one!=0;
+      uint8_t was=sides[h.var], now=was|h.side;
+      if(now!=was){
+	before+= (now&BEFORE) && !(was&BEFORE);
+	after+= (now&AFTER) && !(was&AFTER);
+	if(was!=0)
+	  one--;
+	if(now!=BOTH)
+	  one++;
+	sides[h.var]=now;
+      }
+      if(apart || before==0 || after==0 || one==0)
+	continue;
+      if(had_before && had_after) // an interval split in two
+	bounds= h.side==AFTER ? OPEN_UPPER : OPEN_LOWER;
+      else if(h.side!=BOTH) // meeting an interval already there
+	bounds=CLOSED;
+      else // filling the gap up to an interval
+	bounds= had_after ? OPEN_UPPER : OPEN_LOWER;
+    }
+    for(size_t n=first[t];n<first[t+1];n++)
+      sides[touches[n].var]=0;
+    auto &prev=intervals[ties[t].next-1], &next=intervals[ties[t].next];
+    uint64_t at=ties[t].at;
+    prev.open_upper= bounds==OPEN_UPPER;
+    prev.upper= bounds==OPEN_UPPER ? at : at-1;
+    next.open_lower= bounds==OPEN_LOWER;
+    next.lower= bounds==OPEN_LOWER ? at-1 : at;
+  }
+}
+
+#endif